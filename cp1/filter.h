@@ -0,0 +1,372 @@
+/* Advanced Computer Systems SP23 */
+/* filter.h */
+
+/*
+ * Optional pre-compression transforms for arrays of fixed-width records, in
+ * the spirit of Blosc. "shuffle:N" regroups each chunk so that byte 0 of every
+ * N-byte record comes first, then byte 1, and so on. "delta:N" replaces each
+ * byte with its difference from the same byte of the previous record. Both
+ * turn slowly-varying numeric data into long runs that ZSTD matches cheaply.
+ *
+ * The chosen filter is recorded in a ZSTD skippable frame at the start of the
+ * output, which standard zstd tools skip over, so a decoder can undo it.
+ */
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+#include "common.h"    // HEADER_FUNCTION, CHECK(), malloc_orDie()
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#  define FILTER_X86 1
+#  include <immintrin.h>
+#else
+#  define FILTER_X86 0
+#endif
+
+typedef enum {
+    FILTER_none = 0,
+    FILTER_shuffle = 1,
+    FILTER_delta = 2,
+} FILTER_type;
+
+typedef struct {
+    FILTER_type type;
+    size_t typeSize;      // Record width N in bytes
+    size_t chunkSize;     // Filter is applied to each chunk of this size independently
+} FILTER_spec;
+
+#define FILTER_FRAME_MAGIC  0x184D2A5AU   // One of ZSTD's skippable frame magics
+#define FILTER_FRAME_TAG    0x46534341U   // "ACSF", tells our frame apart from others
+#define FILTER_HEADER_SIZE  20            // Magic + frame size + 12 bytes of content
+#define FILTER_MAX_TYPESIZE 255
+
+/*! filter_parse_orDie() :
+ * Parse "shuffle:N" or "delta:N", dying with a message on anything else.
+ */
+HEADER_FUNCTION FILTER_spec filter_parse_orDie(const char* arg, size_t chunkSize)
+{
+    FILTER_spec spec = { FILTER_none, 0, chunkSize };
+    const char* num = NULL;
+    if (strncmp(arg, "shuffle:", 8) == 0) {
+        spec.type = FILTER_shuffle;
+        num = arg + 8;
+    } else if (strncmp(arg, "delta:", 6) == 0) {
+        spec.type = FILTER_delta;
+        num = arg + 6;
+    }
+    CHECK(num != NULL, "unknown filter '%s', expected shuffle:N or delta:N", arg);
+    int const typeSize = atoi(num);
+    CHECK(typeSize >= 1 && typeSize <= FILTER_MAX_TYPESIZE, "filter width must be 1-%d", FILTER_MAX_TYPESIZE);
+    spec.typeSize = (size_t)typeSize;
+    return spec;
+}
+
+HEADER_FUNCTION void filter_writeLE32(unsigned char* dst, uint32_t value)
+{
+    dst[0] = (unsigned char)value;
+    dst[1] = (unsigned char)(value >> 8);
+    dst[2] = (unsigned char)(value >> 16);
+    dst[3] = (unsigned char)(value >> 24);
+}
+
+HEADER_FUNCTION uint32_t filter_readLE32(const unsigned char* src)
+{
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+/*! filter_writeHeader() :
+ * Serialize spec as a skippable frame into header, which must hold
+ * FILTER_HEADER_SIZE bytes.
+ */
+HEADER_FUNCTION void filter_writeHeader(unsigned char* header, const FILTER_spec* spec)
+{
+    filter_writeLE32(header, FILTER_FRAME_MAGIC);
+    filter_writeLE32(header + 4, FILTER_HEADER_SIZE - 8);
+    filter_writeLE32(header + 8, FILTER_FRAME_TAG);
+    header[12] = (unsigned char)spec->type;
+    header[13] = (unsigned char)spec->typeSize;
+    header[14] = 0;
+    header[15] = 0;
+    filter_writeLE32(header + 16, (uint32_t)spec->chunkSize);
+}
+
+/*! filter_readHeader() :
+ * Look for our skippable frame at the start of src.
+ *
+ * @return FILTER_HEADER_SIZE and fills spec if found, otherwise 0 with
+ * spec->type set to FILTER_none.
+ */
+HEADER_FUNCTION size_t filter_readHeader(const void* src, size_t srcSize, FILTER_spec* spec)
+{
+    const unsigned char* const header = (const unsigned char*)src;
+    spec->type = FILTER_none;
+    if (srcSize < FILTER_HEADER_SIZE
+        || filter_readLE32(header) != FILTER_FRAME_MAGIC
+        || filter_readLE32(header + 4) != FILTER_HEADER_SIZE - 8
+        || filter_readLE32(header + 8) != FILTER_FRAME_TAG) {
+        return 0;
+    }
+    FILTER_type const type = (FILTER_type)header[12];
+    size_t const typeSize = header[13];
+    size_t const chunkSize = filter_readLE32(header + 16);
+    if ((type != FILTER_shuffle && type != FILTER_delta) || typeSize == 0 || chunkSize == 0) {
+        return 0;
+    }
+    spec->type = type;
+    spec->typeSize = typeSize;
+    spec->chunkSize = chunkSize;
+    return FILTER_HEADER_SIZE;
+}
+
+/* Scalar transforms. These handle any record width and the leftovers of the
+ * vector paths; shuffle copies trailing bytes of a partial record unchanged. */
+HEADER_FUNCTION void filter_shuffleScalar(unsigned char* dst, const unsigned char* src, size_t size,
+                                          size_t typeSize, size_t first)
+{
+    size_t const nbElems = size / typeSize;
+    for (size_t i = first; i < nbElems; i++) {
+        for (size_t j = 0; j < typeSize; j++) {
+            dst[j * nbElems + i] = src[i * typeSize + j];
+        }
+    }
+    memcpy(dst + nbElems * typeSize, src + nbElems * typeSize, size - nbElems * typeSize);
+}
+
+HEADER_FUNCTION void filter_unshuffleScalar(unsigned char* dst, const unsigned char* src, size_t size,
+                                            size_t typeSize, size_t first)
+{
+    size_t const nbElems = size / typeSize;
+    for (size_t i = first; i < nbElems; i++) {
+        for (size_t j = 0; j < typeSize; j++) {
+            dst[i * typeSize + j] = src[j * nbElems + i];
+        }
+    }
+    memcpy(dst + nbElems * typeSize, src + nbElems * typeSize, size - nbElems * typeSize);
+}
+
+#if FILTER_X86
+/* Vector shuffles for power-of-two widths. Splitting a run of records into its
+ * even and odd bytes log2(N) times leaves byte j of every record in vector j,
+ * and interleaving log2(N) times puts them back. */
+HEADER_FUNCTION size_t filter_shuffleSSE2(unsigned char* dst, const unsigned char* src, size_t size, size_t typeSize)
+{
+    size_t const nbElems = size / typeSize;
+    size_t const nbVectorElems = nbElems - nbElems % 16;
+    __m128i const lowBytes = _mm_set1_epi16(0x00FF);
+    __m128i v[16], t[16];
+    for (size_t i = 0; i < nbVectorElems; i += 16) {
+        for (size_t k = 0; k < typeSize; k++) {
+            v[k] = _mm_loadu_si128((const __m128i*)(src + i * typeSize + k * 16));
+        }
+        for (size_t step = typeSize; step > 1; step /= 2) {
+            for (size_t m = 0; m < typeSize / 2; m++) {
+                t[m] = _mm_packus_epi16(_mm_and_si128(v[2*m], lowBytes), _mm_and_si128(v[2*m+1], lowBytes));
+                t[m + typeSize/2] = _mm_packus_epi16(_mm_srli_epi16(v[2*m], 8), _mm_srli_epi16(v[2*m+1], 8));
+            }
+            memcpy(v, t, typeSize * sizeof(__m128i));
+        }
+        for (size_t k = 0; k < typeSize; k++) {
+            _mm_storeu_si128((__m128i*)(dst + k * nbElems + i), v[k]);
+        }
+    }
+    return nbVectorElems;
+}
+
+HEADER_FUNCTION size_t filter_unshuffleSSE2(unsigned char* dst, const unsigned char* src, size_t size, size_t typeSize)
+{
+    size_t const nbElems = size / typeSize;
+    size_t const nbVectorElems = nbElems - nbElems % 16;
+    __m128i v[16], t[16];
+    for (size_t i = 0; i < nbVectorElems; i += 16) {
+        for (size_t k = 0; k < typeSize; k++) {
+            v[k] = _mm_loadu_si128((const __m128i*)(src + k * nbElems + i));
+        }
+        for (size_t step = typeSize; step > 1; step /= 2) {
+            for (size_t m = 0; m < typeSize / 2; m++) {
+                t[2*m] = _mm_unpacklo_epi8(v[m], v[m + typeSize/2]);
+                t[2*m+1] = _mm_unpackhi_epi8(v[m], v[m + typeSize/2]);
+            }
+            memcpy(v, t, typeSize * sizeof(__m128i));
+        }
+        for (size_t k = 0; k < typeSize; k++) {
+            _mm_storeu_si128((__m128i*)(dst + i * typeSize + k * 16), v[k]);
+        }
+    }
+    return nbVectorElems;
+}
+
+/* AVX2 versions of the above. The pack and unpack instructions work within
+ * 128-bit lanes, so 64-bit quarters are permuted to keep bytes in order. */
+__attribute__((target("avx2")))
+HEADER_FUNCTION size_t filter_shuffleAVX2(unsigned char* dst, const unsigned char* src, size_t size, size_t typeSize)
+{
+    size_t const nbElems = size / typeSize;
+    size_t const nbVectorElems = nbElems - nbElems % 32;
+    __m256i const lowBytes = _mm256_set1_epi16(0x00FF);
+    __m256i v[16], t[16];
+    for (size_t i = 0; i < nbVectorElems; i += 32) {
+        for (size_t k = 0; k < typeSize; k++) {
+            v[k] = _mm256_loadu_si256((const __m256i*)(src + i * typeSize + k * 32));
+        }
+        for (size_t step = typeSize; step > 1; step /= 2) {
+            for (size_t m = 0; m < typeSize / 2; m++) {
+                __m256i const lo = _mm256_packus_epi16(_mm256_and_si256(v[2*m], lowBytes), _mm256_and_si256(v[2*m+1], lowBytes));
+                __m256i const hi = _mm256_packus_epi16(_mm256_srli_epi16(v[2*m], 8), _mm256_srli_epi16(v[2*m+1], 8));
+                t[m] = _mm256_permute4x64_epi64(lo, 0xD8);
+                t[m + typeSize/2] = _mm256_permute4x64_epi64(hi, 0xD8);
+            }
+            memcpy(v, t, typeSize * sizeof(__m256i));
+        }
+        for (size_t k = 0; k < typeSize; k++) {
+            _mm256_storeu_si256((__m256i*)(dst + k * nbElems + i), v[k]);
+        }
+    }
+    return nbVectorElems;
+}
+
+__attribute__((target("avx2")))
+HEADER_FUNCTION size_t filter_unshuffleAVX2(unsigned char* dst, const unsigned char* src, size_t size, size_t typeSize)
+{
+    size_t const nbElems = size / typeSize;
+    size_t const nbVectorElems = nbElems - nbElems % 32;
+    __m256i v[16], t[16];
+    for (size_t i = 0; i < nbVectorElems; i += 32) {
+        for (size_t k = 0; k < typeSize; k++) {
+            v[k] = _mm256_loadu_si256((const __m256i*)(src + k * nbElems + i));
+        }
+        for (size_t step = typeSize; step > 1; step /= 2) {
+            for (size_t m = 0; m < typeSize / 2; m++) {
+                __m256i const lo = _mm256_permute4x64_epi64(v[m], 0xD8);
+                __m256i const hi = _mm256_permute4x64_epi64(v[m + typeSize/2], 0xD8);
+                t[2*m] = _mm256_unpacklo_epi8(lo, hi);
+                t[2*m+1] = _mm256_unpackhi_epi8(lo, hi);
+            }
+            memcpy(v, t, typeSize * sizeof(__m256i));
+        }
+        for (size_t k = 0; k < typeSize; k++) {
+            _mm256_storeu_si256((__m256i*)(dst + i * typeSize + k * 32), v[k]);
+        }
+    }
+    return nbVectorElems;
+}
+
+__attribute__((target("avx2")))
+HEADER_FUNCTION size_t filter_deltaAVX2(unsigned char* dst, const unsigned char* src, size_t size, size_t typeSize)
+{
+    size_t i = typeSize;
+    for (; i + 32 <= size; i += 32) {
+        __m256i const cur = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i const prev = _mm256_loadu_si256((const __m256i*)(src + i - typeSize));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_sub_epi8(cur, prev));
+    }
+    return i;
+}
+
+HEADER_FUNCTION size_t filter_deltaSSE2(unsigned char* dst, const unsigned char* src, size_t size, size_t typeSize)
+{
+    size_t i = typeSize;
+    for (; i + 16 <= size; i += 16) {
+        __m128i const cur = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i const prev = _mm_loadu_si128((const __m128i*)(src + i - typeSize));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_sub_epi8(cur, prev));
+    }
+    return i;
+}
+
+/* Checked on every call, which is cheap; caching it in a static would race
+ * between compressor threads. */
+HEADER_FUNCTION int filter_hasAVX2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+HEADER_FUNCTION int filter_isVectorWidth(size_t typeSize)
+{
+    return typeSize == 2 || typeSize == 4 || typeSize == 8 || typeSize == 16;
+}
+
+/*! filter_encode() :
+ * Apply spec to one chunk of size bytes from src into dst. The buffers must
+ * not overlap.
+ */
+HEADER_FUNCTION void filter_encode(void* dst, const void* src, size_t size, const FILTER_spec* spec)
+{
+    unsigned char* const d = (unsigned char*)dst;
+    const unsigned char* const s = (const unsigned char*)src;
+    size_t const typeSize = spec->typeSize;
+
+    if (spec->type == FILTER_shuffle) {
+        size_t first = 0;
+#if FILTER_X86
+        if (filter_isVectorWidth(typeSize)) {
+            first = filter_hasAVX2() ? filter_shuffleAVX2(d, s, size, typeSize)
+                                     : filter_shuffleSSE2(d, s, size, typeSize);
+        }
+#endif
+        filter_shuffleScalar(d, s, size, typeSize, first);
+    } else if (spec->type == FILTER_delta) {
+        size_t const head = size < typeSize ? size : typeSize;
+        memcpy(d, s, head);
+        size_t i = head;
+#if FILTER_X86
+        if (size > typeSize) {
+            i = filter_hasAVX2() ? filter_deltaAVX2(d, s, size, typeSize)
+                                 : filter_deltaSSE2(d, s, size, typeSize);
+        }
+#endif
+        for (; i < size; i++) {
+            d[i] = (unsigned char)(s[i] - s[i - typeSize]);
+        }
+    } else {
+        memcpy(d, s, size);
+    }
+}
+
+/*! filter_decode() :
+ * Undo filter_encode() on one chunk of size bytes from src into dst. The
+ * buffers must not overlap.
+ */
+HEADER_FUNCTION void filter_decode(void* dst, const void* src, size_t size, const FILTER_spec* spec)
+{
+    unsigned char* const d = (unsigned char*)dst;
+    const unsigned char* const s = (const unsigned char*)src;
+    size_t const typeSize = spec->typeSize;
+
+    if (spec->type == FILTER_shuffle) {
+        size_t first = 0;
+#if FILTER_X86
+        if (filter_isVectorWidth(typeSize)) {
+            first = filter_hasAVX2() ? filter_unshuffleAVX2(d, s, size, typeSize)
+                                     : filter_unshuffleSSE2(d, s, size, typeSize);
+        }
+#endif
+        filter_unshuffleScalar(d, s, size, typeSize, first);
+    } else if (spec->type == FILTER_delta) {
+        /* Each byte depends on the one a record earlier, so this stays scalar */
+        for (size_t i = 0; i < size; i++) {
+            d[i] = (unsigned char)(i < typeSize ? s[i] : s[i] + d[i - typeSize]);
+        }
+    } else {
+        memcpy(d, s, size);
+    }
+}
+
+/*! filter_decodeBuffer() :
+ * Undo the filter in place over a whole decompressed stream, chunk by chunk.
+ */
+HEADER_FUNCTION void filter_decodeBuffer(void* buffer, size_t size, const FILTER_spec* spec)
+{
+    if (spec->type == FILTER_none || size == 0) return;
+    size_t const chunkSize = spec->chunkSize;
+    unsigned char* const scratch = malloc_orDie(size < chunkSize ? size : chunkSize);
+    for (size_t pos = 0; pos < size; pos += chunkSize) {
+        size_t const len = (size - pos < chunkSize) ? size - pos : chunkSize;
+        memcpy(scratch, (unsigned char*)buffer + pos, len);
+        filter_decode((unsigned char*)buffer + pos, scratch, len, spec);
+    }
+    free(scratch);
+}
+
+#endif
@@ -19,7 +19,15 @@
 #include <string.h>    
 #include <zstd.h>      // presumes zstd library is installed
 #include <pthread.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>      // clock_gettime
+#include <unistd.h>    // close, unlink
+#include <sys/socket.h>
+#include <sys/time.h>  // struct timeval for SO_SNDTIMEO
+#include <sys/un.h>
 #include "common.h"    // Helper functions, CHECK(), and CHECK_ZSTD()
+#include "filter.h"    // Optional shuffle/delta transforms applied before compression
 
 /* Define wrapper structure to pass args for pthreadCompressor during pthread init */
 typedef struct pthreadWrapper {
@@ -31,6 +39,7 @@ typedef struct pthreadWrapper {
     size_t outSize;
     size_t outPos;
     int cLevel;       // Compression level
+    const FILTER_spec* filter;   // Transform applied to the chunk before compressing
 } pthreadWrapper_t;
 
 /* Uses a pthread to compress a chunk of data with ZSTD streaming compression */
@@ -47,18 +56,30 @@ static void *pthreadCompressor(void* args) {
     CHECK_ZSTD( ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, ptw->cLevel) );
     CHECK_ZSTD( ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1) );
 
-    ZSTD_inBuffer input = { ptw->inPtr, ptw->inSize, 0 };
+    /* Run the optional filter into a scratch buffer and compress that instead. */
+    char* filtered = NULL;
+    if (ptw->filter->type != FILTER_none) {
+        filtered = malloc_orDie(ptw->inSize);
+        filter_encode(filtered, ptw->inPtr, ptw->inSize, ptw->filter);
+    }
+
+    ZSTD_inBuffer input = { filtered ? filtered : ptw->inPtr, ptw->inSize, 0 };
 
-    ptw->outPtr = malloc_orDie(ptw->inSize);
+    /* Each chunk becomes its own frame, so the output buffer must fit the
+     * worst case for ZSTD_e_end to finish in one call. */
+    ptw->outSize = ZSTD_compressBound(ptw->inSize);
+    ptw->outPtr = malloc_orDie(ptw->outSize);
     ZSTD_outBuffer output = { ptw->outPtr, ptw->outSize, 0 };
 
     /* Perform the actual compression. */
-    size_t const remaining = ZSTD_compressStream2(cctx, &output , &input, ptw->cLevel);
+    size_t const remaining = ZSTD_compressStream2(cctx, &output , &input, ZSTD_e_end);
     CHECK_ZSTD(remaining);
+    CHECK(remaining == 0, "frame not fully flushed!");
 
     ptw->outPos = output.pos;
 
     ZSTD_freeCCtx(cctx);
+    free(filtered);
 
     return NULL;
 }
@@ -73,16 +94,686 @@ static char* createOutFilename_orDie(const char* filename) {
     return (char*)outSpace;
 }
 
+/* Decodes every frame in src into a freshly allocated *outPtr, undoing any
+ * filter recorded at the start of src. Frames written without a content size
+ * are common, so this uses the streaming API and grows the output as needed,
+ * up to maxSize. Returns NULL on success or an error message; *outPtr must be
+ * freed either way.
+ */
+static const char* decompressAll_orNull(ZSTD_DCtx* dctx, const void* src, size_t srcSize,
+                                        size_t maxSize, char** outPtr, size_t* outSize) {
+    FILTER_spec filter = { FILTER_none, 0, 0 };
+    filter_readHeader(src, srcSize, &filter);
+
+    unsigned long long const contentSize = ZSTD_getFrameContentSize(src, srcSize);
+    size_t cap = ZSTD_DStreamOutSize();
+    if (contentSize != ZSTD_CONTENTSIZE_ERROR && contentSize != ZSTD_CONTENTSIZE_UNKNOWN
+        && contentSize > cap && contentSize <= maxSize) {
+        cap = (size_t)contentSize;
+    }
+    char* out = malloc_orDie(cap);
+    *outPtr = out;
+    *outSize = 0;
+
+    /* An empty input file compresses to an empty output with no frames */
+    if (srcSize == 0) return NULL;
+
+    CHECK_ZSTD( ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only) );
+    ZSTD_inBuffer input = { src, srcSize, 0 };
+    ZSTD_outBuffer output = { out, cap, 0 };
+    for (;;) {
+        size_t const ret = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(ret)) return ZSTD_getErrorName(ret);
+        if (input.pos == input.size && ret == 0) break;
+        if (input.pos == input.size && output.pos < output.size) return "truncated zstd frame";
+        if (output.pos == output.size) {
+            if (cap >= maxSize) return "decompressed size too large";
+            cap *= 2;
+            out = realloc(out, cap);
+            CHECK(out != NULL, "realloc failed!");
+            *outPtr = out;
+            output.dst = out;
+            output.size = cap;
+        }
+    }
+
+    filter_decodeBuffer(out, output.pos, &filter);
+    *outSize = output.pos;
+    return NULL;
+}
+
+/* DAEMON MODE: keeps the worker pool and per-level contexts warm and serves
+ * compress/decompress requests from many clients over a Unix domain socket.
+ * Each request is a daemonRequestHeader followed by its payload, each reply a
+ * daemonReplyHeader followed by its payload. Fields are in host byte order
+ * since both ends live on the same machine.
+ */
+#define DAEMON_OP_COMPRESS   1
+#define DAEMON_OP_DECOMPRESS 2
+#define DAEMON_MAX_PAYLOAD   ((uint64_t)256 << 20)   // Largest request or reply we accept (256MB)
+#define DAEMON_MAX_QUEUED    8                       // Per-client requests in flight before we stop reading
+#define DAEMON_SEND_TIMEOUT_S 10                     // Drop a client that stops reading its replies
+
+typedef struct daemonRequestHeader {
+    uint32_t op;        // DAEMON_OP_COMPRESS or DAEMON_OP_DECOMPRESS
+    int32_t cLevel;     // Compression level, ignored for decompression
+    uint64_t size;      // Payload bytes following the header
+} daemonRequestHeader_t;
+
+typedef struct daemonReplyHeader {
+    uint32_t status;    // 0 on success, otherwise the payload is an error message
+    uint32_t padding;
+    uint64_t size;      // Payload bytes following the header
+    uint64_t queueUs;   // Time the request waited for a worker
+    uint64_t workUs;    // Time a worker spent on the request
+} daemonReplyHeader_t;
+
+typedef struct daemonJob {
+    struct daemonJob* next;
+    daemonRequestHeader_t hdr;
+    char* payload;
+    uint64_t enqueuedUs;
+} daemonJob_t;
+
+typedef struct daemonReply {
+    struct daemonReply* next;
+    daemonReplyHeader_t hdr;
+    char* payload;      // Result, or the error message if hdr.status != 0
+} daemonReply_t;
+
+struct daemonState;
+
+/* One connected client. Its reader thread queues requests here, at most one
+ * worker serves it at a time, and its writer thread sends the replies back in
+ * request order. Everything but fd and id is guarded by d->lock. */
+typedef struct daemonClient {
+    struct daemonClient* next;   // Ring of connected clients
+    struct daemonClient* prev;
+    struct daemonState* d;
+    int fd;
+    int id;
+    daemonJob_t* head;           // Pending requests in arrival order
+    daemonJob_t* tail;
+    int nbQueued;
+    daemonReply_t* replyHead;    // Finished replies waiting to be sent
+    daemonReply_t* replyTail;
+    int nbReplies;
+    pthread_cond_t replyReady;   // A reply was queued, or the client is winding down
+    int nbServed;
+    int busy;                    // A worker is handling one of our requests
+    int closed;                  // Reader saw EOF or a bad request
+    int broken;                  // A reply failed to send, drop what is left
+} daemonClient_t;
+
+typedef struct daemonState {
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;    // A client got a new request
+    pthread_cond_t spaceReady;   // A client has fewer requests in flight
+    daemonClient_t* cursor;      // Next client to serve, round-robin
+    int nbClients;
+    int nextClientId;
+} daemonState_t;
+
+/* Per-worker state that outlives individual requests */
+typedef struct daemonWorker {
+    daemonState_t* d;
+    ZSTD_CCtx** cctxs;           // One context per compression level, created on first use
+    ZSTD_DCtx* dctx;
+} daemonWorker_t;
+
+static const char* daemonSocketPath = NULL;
+
+static uint64_t daemon_nowUs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Reads exactly size bytes. Returns 0 on success, -1 on EOF or error. */
+static int daemon_readAll(int fd, void* buffer, size_t size) {
+    char* ptr = buffer;
+    while (size > 0) {
+        ssize_t const r = recv(fd, ptr, size, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        ptr += r;
+        size -= (size_t)r;
+    }
+    return 0;
+}
+
+/* Writes exactly size bytes. Returns 0 on success, -1 if the peer went away. */
+static int daemon_writeAll(int fd, const void* buffer, size_t size) {
+    const char* ptr = buffer;
+    while (size > 0) {
+        ssize_t const w = send(fd, ptr, size, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        ptr += w;
+        size -= (size_t)w;
+    }
+    return 0;
+}
+
+/* Picks the next client with a pending request that no worker is serving,
+ * starting after the last client served. Caller holds d->lock. */
+static daemonClient_t* daemon_nextClient_locked(daemonState_t* d) {
+    daemonClient_t* c = d->cursor;
+    for (int i = 0; i < d->nbClients; i++, c = c->next) {
+        if (!c->busy && !c->broken && c->head != NULL) {
+            d->cursor = c->next;
+            return c;
+        }
+    }
+    return NULL;
+}
+
+/* Requests a client has in the daemon: queued, being worked on, or waiting
+ * to be sent back. Caller holds d->lock. */
+static int daemon_nbOutstanding_locked(const daemonClient_t* c) {
+    return c->nbQueued + c->busy + c->nbReplies;
+}
+
+/* Unlinks a finished client from the ring and frees it along with anything
+ * it left queued. Caller holds d->lock. */
+static void daemon_removeClient_locked(daemonState_t* d, daemonClient_t* c) {
+    if (--d->nbClients == 0) {
+        d->cursor = NULL;
+    } else {
+        c->prev->next = c->next;
+        c->next->prev = c->prev;
+        if (d->cursor == c) d->cursor = c->next;
+    }
+    while (c->head != NULL) {
+        daemonJob_t* const job = c->head;
+        c->head = job->next;
+        free(job->payload);
+        free(job);
+    }
+    while (c->replyHead != NULL) {
+        daemonReply_t* const reply = c->replyHead;
+        c->replyHead = reply->next;
+        free(reply->payload);
+        free(reply);
+    }
+    fprintf(stderr, "client %d: disconnected after %d requests\n", c->id, c->nbServed);
+    pthread_cond_destroy(&c->replyReady);
+    close(c->fd);
+    free(c);
+}
+
+static ZSTD_CCtx* daemon_getCCtx(daemonWorker_t* w, int cLevel) {
+    if (w->cctxs[cLevel] == NULL) {
+        ZSTD_CCtx* const cctx = ZSTD_createCCtx();
+        CHECK(cctx != NULL, "ZSTD_createCCtx() failed!");
+        CHECK_ZSTD( ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, cLevel) );
+        CHECK_ZSTD( ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1) );
+        w->cctxs[cLevel] = cctx;
+    }
+    return w->cctxs[cLevel];
+}
+
+/* Compresses or decompresses one request. The reply is handed back for the
+ * client's writer thread to send, so workers never block on a socket. */
+static daemonReply_t* daemon_serve(daemonWorker_t* w, const daemonClient_t* c, const daemonJob_t* job) {
+    uint64_t const startUs = daemon_nowUs();
+    size_t const inSize = (size_t)job->hdr.size;
+    const char* err = NULL;
+    char* out = NULL;
+    size_t outSize = 0;
+
+    if (job->hdr.op == DAEMON_OP_COMPRESS) {
+        int const cLevel = job->hdr.cLevel;
+        if (cLevel < 1 || cLevel > ZSTD_maxCLevel()) {
+            err = "compression level out of range";
+        } else {
+            size_t const bound = ZSTD_compressBound(inSize);
+            out = malloc_orDie(bound);
+            size_t const cSize = ZSTD_compress2(daemon_getCCtx(w, cLevel), out, bound, job->payload, inSize);
+            if (ZSTD_isError(cSize)) err = ZSTD_getErrorName(cSize);
+            else outSize = cSize;
+        }
+    } else if (job->hdr.op == DAEMON_OP_DECOMPRESS) {
+        err = decompressAll_orNull(w->dctx, job->payload, inSize, (size_t)DAEMON_MAX_PAYLOAD, &out, &outSize);
+    } else {
+        err = "unknown operation";
+    }
+
+    uint64_t const endUs = daemon_nowUs();
+    daemonReply_t* const reply = malloc_orDie(sizeof(daemonReply_t));
+    memset(reply, 0, sizeof(*reply));
+    reply->hdr.status = (err != NULL);
+    reply->hdr.size = (err != NULL) ? strlen(err) : outSize;
+    reply->hdr.queueUs = startUs - job->enqueuedUs;
+    reply->hdr.workUs = endUs - startUs;
+    if (err != NULL) {
+        /* Error strings are static, copy one so every reply owns its payload */
+        free(out);
+        out = malloc_orDie(reply->hdr.size + 1);
+        memcpy(out, err, reply->hdr.size + 1);
+    }
+    reply->payload = out;
+
+    fprintf(stderr, "client %d: %s %zu -> %llu bytes, queued %llu us, worked %llu us%s%s\n",
+            c->id, job->hdr.op == DAEMON_OP_DECOMPRESS ? "decompress" : "compress",
+            inSize, (unsigned long long)(err != NULL ? 0 : outSize),
+            (unsigned long long)reply->hdr.queueUs, (unsigned long long)reply->hdr.workUs,
+            err != NULL ? ", error: " : "", err != NULL ? err : "");
+    return reply;
+}
+
+/* Worker thread: serves clients round-robin, one request at a time each */
+static void* daemonWorkerLoop(void* args) {
+    daemonWorker_t* const w = (daemonWorker_t*)args;
+    daemonState_t* const d = w->d;
+
+    for (;;) {
+        pthread_mutex_lock(&d->lock);
+        daemonClient_t* c;
+        while ((c = daemon_nextClient_locked(d)) == NULL) {
+            pthread_cond_wait(&d->workReady, &d->lock);
+        }
+        daemonJob_t* const job = c->head;
+        c->head = job->next;
+        if (c->head == NULL) c->tail = NULL;
+        c->nbQueued--;
+        c->busy = 1;
+        pthread_mutex_unlock(&d->lock);
+
+        daemonReply_t* const reply = daemon_serve(w, c, job);
+        free(job->payload);
+        free(job);
+
+        pthread_mutex_lock(&d->lock);
+        if (c->replyTail != NULL) c->replyTail->next = reply;
+        else c->replyHead = reply;
+        c->replyTail = reply;
+        c->nbReplies++;
+        c->busy = 0;
+        c->nbServed++;
+        pthread_cond_signal(&c->replyReady);
+        if (c->head != NULL) pthread_cond_signal(&d->workReady);
+        pthread_mutex_unlock(&d->lock);
+    }
+    return NULL;
+}
+
+/* Reader thread: queues requests from one client until it disconnects */
+static void* daemonClientReader(void* args) {
+    daemonClient_t* const c = (daemonClient_t*)args;
+    daemonState_t* const d = c->d;
+
+    for (;;) {
+        daemonRequestHeader_t hdr;
+        if (daemon_readAll(c->fd, &hdr, sizeof(hdr)) != 0) break;
+        if (hdr.size > DAEMON_MAX_PAYLOAD) {
+            fprintf(stderr, "client %d: request of %llu bytes too large, dropping client\n",
+                    c->id, (unsigned long long)hdr.size);
+            break;
+        }
+
+        daemonJob_t* const job = malloc_orDie(sizeof(daemonJob_t));
+        job->next = NULL;
+        job->hdr = hdr;
+        job->payload = malloc_orDie(hdr.size > 0 ? (size_t)hdr.size : 1);
+        if (daemon_readAll(c->fd, job->payload, (size_t)hdr.size) != 0) {
+            free(job->payload);
+            free(job);
+            break;
+        }
+        job->enqueuedUs = daemon_nowUs();
+
+        /* Stop reading while the client has too much in flight, so one that
+         * never collects its replies cannot make the daemon buffer without bound */
+        pthread_mutex_lock(&d->lock);
+        while (daemon_nbOutstanding_locked(c) >= DAEMON_MAX_QUEUED && !c->broken) {
+            pthread_cond_wait(&d->spaceReady, &d->lock);
+        }
+        if (c->broken) {
+            pthread_mutex_unlock(&d->lock);
+            free(job->payload);
+            free(job);
+            break;
+        }
+        if (c->tail != NULL) c->tail->next = job;
+        else c->head = job;
+        c->tail = job;
+        c->nbQueued++;
+        pthread_cond_signal(&d->workReady);
+        pthread_mutex_unlock(&d->lock);
+    }
+
+    /* Requests already queued are still answered by the writer */
+    pthread_mutex_lock(&d->lock);
+    c->closed = 1;
+    pthread_cond_signal(&c->replyReady);
+    pthread_mutex_unlock(&d->lock);
+    return NULL;
+}
+
+/* Writer thread: sends replies to one client in order, then tears it down
+ * once the reader is done and nothing is left to answer */
+static void* daemonClientWriter(void* args) {
+    daemonClient_t* const c = (daemonClient_t*)args;
+    daemonState_t* const d = c->d;
+
+    pthread_mutex_lock(&d->lock);
+    for (;;) {
+        while (c->replyHead == NULL && !c->broken
+               && !(c->closed && c->busy == 0 && c->head == NULL)) {
+            pthread_cond_wait(&c->replyReady, &d->lock);
+        }
+        if (c->replyHead == NULL || c->broken) break;
+
+        daemonReply_t* const reply = c->replyHead;
+        c->replyHead = reply->next;
+        if (c->replyHead == NULL) c->replyTail = NULL;
+        pthread_mutex_unlock(&d->lock);
+
+        /* Sends give up after DAEMON_SEND_TIMEOUT_S (SO_SNDTIMEO), so a client
+         * that stops reading only loses its own connection */
+        int const sent = daemon_writeAll(c->fd, &reply->hdr, sizeof(reply->hdr)) == 0
+                      && daemon_writeAll(c->fd, reply->payload, (size_t)reply->hdr.size) == 0;
+        free(reply->payload);
+        free(reply);
+
+        pthread_mutex_lock(&d->lock);
+        c->nbReplies--;
+        if (!sent) {
+            fprintf(stderr, "client %d: reply not sent, dropping client\n", c->id);
+            c->broken = 1;
+            shutdown(c->fd, SHUT_RDWR);   // Wake the reader so it exits too
+        }
+        pthread_cond_broadcast(&d->spaceReady);
+    }
+
+    /* Wait for the reader to exit and any worker to hand back its reply */
+    while (!c->closed || c->busy) {
+        pthread_cond_wait(&c->replyReady, &d->lock);
+    }
+    daemon_removeClient_locked(d, c);
+    pthread_mutex_unlock(&d->lock);
+    return NULL;
+}
+
+static void daemon_onSignal(int sig) {
+    (void)sig;
+    unlink(daemonSocketPath);
+    _exit(0);
+}
+
+static void daemon_fillAddress(struct sockaddr_un* addr, const char* socketPath) {
+    CHECK(strlen(socketPath) < sizeof(addr->sun_path), "socket path too long!");
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, socketPath);
+}
+
+/* Runs the daemon until SIGINT or SIGTERM */
+static int runDaemon(const char* socketPath, int nbThreads) {
+    struct sockaddr_un addr;
+    daemon_fillAddress(&addr, socketPath);
+
+    int const lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK(lfd >= 0, "socket: %s", strerror(errno));
+    unlink(socketPath);   // Clear a stale socket left behind by a previous daemon
+    CHECK(bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) == 0, "bind %s: %s", socketPath, strerror(errno));
+    CHECK(listen(lfd, SOMAXCONN) == 0, "listen: %s", strerror(errno));
+
+    daemonSocketPath = socketPath;
+    signal(SIGINT, daemon_onSignal);
+    signal(SIGTERM, daemon_onSignal);
+
+/* DAEMON: START WARM WORKERS */
+    daemonState_t d;
+    memset(&d, 0, sizeof(d));
+    pthread_mutex_init(&d.lock, NULL);
+    pthread_cond_init(&d.workReady, NULL);
+    pthread_cond_init(&d.spaceReady, NULL);
+
+    pthread_t pthreads[nbThreads];
+    daemonWorker_t workers[nbThreads];
+    for (int i = 0; i < nbThreads; i++) {
+        workers[i].d = &d;
+        workers[i].cctxs = calloc((size_t)ZSTD_maxCLevel() + 1, sizeof(ZSTD_CCtx*));
+        CHECK(workers[i].cctxs != NULL, "calloc failed!");
+        workers[i].dctx = ZSTD_createDCtx();
+        CHECK(workers[i].dctx != NULL, "ZSTD_createDCtx() failed!");
+        CHECK(pthread_create(pthreads+i, NULL, daemonWorkerLoop, (void*)(&workers[i])) == 0, "pthread_create failed!");
+    }
+
+    fprintf(stderr, "daemon listening on %s with %d workers\n", socketPath, nbThreads);
+
+/* DAEMON LOOP: ACCEPT CLIENTS AND HAND THEM TO A READER THREAD */
+    for (;;) {
+        int const fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) {
+                /* Errors like EMFILE persist until a client goes away, so
+                 * back off instead of spinning */
+                perror("accept");
+                struct timespec const backoff = { 0, 100 * 1000 * 1000 };
+                nanosleep(&backoff, NULL);
+            }
+            continue;
+        }
+
+        struct timeval const sendTimeout = { DAEMON_SEND_TIMEOUT_S, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+        daemonClient_t* const c = malloc_orDie(sizeof(daemonClient_t));
+        memset(c, 0, sizeof(*c));
+        c->d = &d;
+        c->fd = fd;
+        pthread_cond_init(&c->replyReady, NULL);
+
+        pthread_mutex_lock(&d.lock);
+        c->id = d.nextClientId++;
+        if (d.cursor == NULL) {
+            c->next = c->prev = c;
+            d.cursor = c;
+        } else {
+            c->next = d.cursor;
+            c->prev = d.cursor->prev;
+            c->prev->next = c;
+            d.cursor->prev = c;
+        }
+        d.nbClients++;
+        pthread_mutex_unlock(&d.lock);
+
+        pthread_t reader, writer;
+        CHECK(pthread_create(&reader, NULL, daemonClientReader, (void*)c) == 0, "pthread_create failed!");
+        CHECK(pthread_create(&writer, NULL, daemonClientWriter, (void*)c) == 0, "pthread_create failed!");
+        pthread_detach(reader);
+        pthread_detach(writer);
+    }
+    return 0;
+}
+
+static char* createDecompressedFilename_orDie(const char* filename) {
+    size_t const inL = strlen(filename);
+    size_t const outL = inL + 5;
+    char* const outSpace = malloc_orDie(outL);
+    memset(outSpace, 0, outL);
+    strcat(outSpace, filename);
+    if (inL > 4 && strcmp(outSpace + inL - 4, ".zst") == 0) {
+        outSpace[inL - 4] = '\0';
+    } else {
+        strcat(outSpace, ".out");
+    }
+    return outSpace;
+}
+
+/* Writes one decoded block, undoing the filter into scratch first if there is one */
+static void writeBlock_orDie(const char* block, size_t size, char* scratch,
+                             const FILTER_spec* filter, FILE* fout) {
+    if (scratch != NULL) {
+        filter_decode(scratch, block, size, filter);
+        block = scratch;
+    }
+    fwrite_orDie(block, size, fout);
+}
+
+/* Decompresses FILE.zst produced by this program, undoing any filter. Streams
+ * from disk to disk, so there is no limit on the file size. */
+static int decompressFile(const char* inFilename) {
+    char* const outFilename = createDecompressedFilename_orDie(inFilename);
+    FILE* const fin  = fopen_orDie(inFilename, "rb");
+    FILE* const fout = fopen_orDie(outFilename, "wb");
+
+    ZSTD_DCtx* const dctx = ZSTD_createDCtx();
+    CHECK(dctx != NULL, "ZSTD_createDCtx() failed!");
+
+    size_t const buffInSize = ZSTD_DStreamInSize();
+    char*  const buffIn = malloc_orDie(buffInSize);
+    size_t read = fread_orDie(buffIn, buffInSize, fin);
+
+    /* A recorded filter sits at the very start of the file. ZSTD skips over
+     * that frame by itself, so the input is fed to the decoder unchanged. */
+    FILTER_spec filter = { FILTER_none, 0, 0 };
+    filter_readHeader(buffIn, read, &filter);
+
+    /* The filter was applied per chunk, so decode into chunk-sized blocks and
+     * undo it on each one before writing it out. */
+    size_t const blockSize = (filter.type != FILTER_none) ? filter.chunkSize : ZSTD_DStreamOutSize();
+    char* const block = malloc_orDie(blockSize);
+    char* const unfiltered = (filter.type != FILTER_none) ? malloc_orDie(blockSize) : NULL;
+    size_t blockPos = 0;
+    size_t lastRet = 0;
+
+    while (read > 0) {
+        ZSTD_inBuffer input = { buffIn, read, 0 };
+        int outputFull = 0;
+        /* Keep going while a frame is unfinished and the decoder may still
+         * hold output it could not flush */
+        while (input.pos < input.size || (outputFull && lastRet != 0)) {
+            ZSTD_outBuffer output = { block + blockPos, blockSize - blockPos, 0 };
+            lastRet = ZSTD_decompressStream(dctx, &output, &input);
+            CHECK_ZSTD(lastRet);
+            blockPos += output.pos;
+            outputFull = (output.pos == output.size);
+            if (blockPos == blockSize) {
+                writeBlock_orDie(block, blockPos, unfiltered, &filter, fout);
+                blockPos = 0;
+            }
+        }
+        read = fread_orDie(buffIn, buffInSize, fin);
+    }
+    CHECK(lastRet == 0, "%s: truncated zstd frame", inFilename);
+
+    /* Write out the final partial block */
+    if (blockPos > 0) {
+        writeBlock_orDie(block, blockPos, unfiltered, &filter, fout);
+    }
+
+    ZSTD_freeDCtx(dctx);
+    fclose_orDie(fin);
+    fclose_orDie(fout);
+    free(buffIn);
+    free(block);
+    free(unfiltered);
+    free(outFilename);
+    return 0;
+}
+
+/* Sends one file to a running daemon and saves the reply next to it */
+static int runClient(const char* socketPath, const char* opName, const char* inFilename, int cLevel) {
+    int const decompress = strcmp(opName, "d") == 0;
+    CHECK(decompress || strcmp(opName, "c") == 0, "OP must be c or d!");
+
+    struct sockaddr_un addr;
+    daemon_fillAddress(&addr, socketPath);
+    int const fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK(fd >= 0, "socket: %s", strerror(errno));
+    CHECK(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0, "connect %s: %s", socketPath, strerror(errno));
+
+    size_t inSize;
+    void* const in = mallocAndLoadFile_orDie(inFilename, &inSize);
+
+    daemonRequestHeader_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.op = decompress ? DAEMON_OP_DECOMPRESS : DAEMON_OP_COMPRESS;
+    hdr.cLevel = cLevel;
+    hdr.size = inSize;
+    CHECK(daemon_writeAll(fd, &hdr, sizeof(hdr)) == 0, "failed to send request!");
+    CHECK(daemon_writeAll(fd, in, inSize) == 0, "failed to send request!");
+
+    daemonReplyHeader_t reply;
+    CHECK(daemon_readAll(fd, &reply, sizeof(reply)) == 0, "daemon closed the connection!");
+    CHECK(reply.size <= DAEMON_MAX_PAYLOAD, "reply too large!");
+    char* const out = malloc_orDie(reply.size > 0 ? (size_t)reply.size : 1);
+    CHECK(daemon_readAll(fd, out, (size_t)reply.size) == 0, "daemon closed the connection!");
+    close(fd);
+
+    if (reply.status != 0) {
+        fprintf(stderr, "daemon error: %.*s\n", (int)reply.size, out);
+        free(in);
+        free(out);
+        return 1;
+    }
+
+    char* const outFilename = decompress ? createDecompressedFilename_orDie(inFilename)
+                                         : createOutFilename_orDie(inFilename);
+    saveFile_orDie(outFilename, out, (size_t)reply.size);
+    printf("%s : %zu -> %llu bytes, queued %llu us, worked %llu us\n",
+           outFilename, inSize, (unsigned long long)reply.size,
+           (unsigned long long)reply.queueUs, (unsigned long long)reply.workUs);
+
+    free(in);
+    free(out);
+    free(outFilename);
+    return 0;
+}
+
 int main(int argc, const char** argv) {
     const char* const exeName = argv[0];
 
     if (argc < 2) {
         printf("wrong arguments\n");
         printf("usage:\n");
-        printf("%s FILE [LEVEL] [THREADS]\n", exeName);
+        printf("%s [--filter=shuffle:N|delta:N] FILE [LEVEL] [THREADS]\n", exeName);
+        printf("%s -d FILE.zst\n", exeName);
+        printf("%s --daemon SOCKET [THREADS]\n", exeName);
+        printf("%s --client SOCKET c|d FILE [LEVEL]\n", exeName);
         return 1;
     }
 
+    if (strcmp(argv[1], "--daemon") == 0) {
+        CHECK(argc >= 3, "missing SOCKET!");
+        int nbThreads = 4;
+        if (argc >= 4) {
+          nbThreads = atoi (argv[3]);
+          CHECK(nbThreads > 0, "can't parse THREADS!");
+        }
+        return runDaemon(argv[2], nbThreads);
+    }
+
+    if (strcmp(argv[1], "--client") == 0) {
+        CHECK(argc >= 5, "missing SOCKET, OP or FILE!");
+        int cLevel = 1;
+        if (argc >= 6) {
+          cLevel = atoi (argv[5]);
+          CHECK(cLevel != 0, "can't parse LEVEL!");
+        }
+        return runClient(argv[2], argv[3], argv[4], cLevel);
+    }
+
+    if (strcmp(argv[1], "-d") == 0) {
+        CHECK(argc >= 3, "missing FILE!");
+        return decompressFile(argv[2]);
+    }
+
+    size_t const toRead = 16*1024;     //Chunk size hardcoded at 16kb
+
+    /* An optional --filter=... may come first; the rest are positional. */
+    FILTER_spec filter = { FILTER_none, 0, toRead };
+    if (strncmp(argv[1], "--filter=", 9) == 0) {
+        filter = filter_parse_orDie(argv[1] + 9, toRead);
+        argv++;
+        argc--;
+        CHECK(argc >= 2, "missing FILE!");
+    }
+
     int cLevel = 1;
     int nbThreads = 4;
 
@@ -103,13 +794,20 @@ int main(int argc, const char** argv) {
 /* MAIN THREAD: PREP THREAD RESOURCES */
     pthread_t pthreads[nbThreads];
     struct pthreadWrapper wrappers[nbThreads];
+    memset(wrappers, 0, sizeof(wrappers));   // Cleanup frees every slot, even ones never used
 
 /* MAIN THREAD: INITIALIZE FILES */
     FILE* const fin  = fopen_orDie(inFilename, "rb");
     FILE* const fout = fopen_orDie(outFilename, "wb"); 
 
+    /* Record the filter up front so the decoder knows how to undo it */
+    if (filter.type != FILTER_none) {
+        unsigned char header[FILTER_HEADER_SIZE];
+        filter_writeHeader(header, &filter);
+        fwrite_orDie(header, sizeof(header), fout);
+    }
+
 /* MAIN THREAD LOOP: READ AND PROCESS CHUNKS */
-    size_t const toRead = 16*1024;     //Chunk size hardcoded at 16kb
     int lastChunk = 0;
     char* running = malloc(sizeof(char)*nbThreads);  //Tracks active threads
     memset(running, 0, nbThreads);
@@ -122,20 +820,15 @@ int main(int argc, const char** argv) {
             ptw.inPtr = malloc_orDie(toRead);
             size_t read = fread_orDie(ptw.inPtr, toRead, fin);
 
-            /* Select the flush mode.
-             * If the read may not be finished (read == toRead) we use
-             * ZSTD_e_continue. If this is the last chunk, we use ZSTD_e_end.
-             * Zstd optimizes the case where the first flush mode is ZSTD_e_end,
-             * since it knows it is compressing the entire source in one pass.
-             */
+            /* A short read means we reached the end of the input file */
             lastChunk = (read < toRead);
-            ZSTD_EndDirective const mode = lastChunk ? ZSTD_e_end : ZSTD_e_continue;
 
             /* MAIN THREAD LOOP: MAKE THREAD FOR CURRENT CHUNK */
             if(read > 0) {
                 ptw.id = i;
                 ptw.inSize = read;
                 ptw.cLevel = cLevel;
+                ptw.filter = &filter;
 
                 running[i] = 1;
 